@@ -25,4 +25,12 @@ using sInt = int;
   #endif
 #else
   #define SRISCV_CX_STATIC
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define SRISCV_FORCE_INLINE __attribute__((always_inline)) inline
+#elif defined(_MSC_VER)
+  #define SRISCV_FORCE_INLINE __forceinline
+#else
+  #define SRISCV_FORCE_INLINE inline
 #endif
\ No newline at end of file
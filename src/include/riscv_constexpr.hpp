@@ -0,0 +1,97 @@
+#ifndef SIMPLERISCV_CONSTEXPR_HPP
+#define SIMPLERISCV_CONSTEXPR_HPP
+
+#include "riscv_vm.hpp"
+#include "riscv_extensions.hpp"
+
+// Machine that can run entirely at compile time. It decodes and runs instructions with the same
+// code as RISCVContainer (riscv_extensions.hpp), but holds the guest image by value and needs no allocation or host
+// clock, so a program and everything it computes can be a constant:
+//
+//     constexpr auto vm = [] {
+//         RISCVConstexprContainer vm({0x00178793, 0x00178793}); // addi a5,a5,1 (twice)
+//         vm.Execute();
+//         return vm;
+//     }();
+//     static_assert(vm.xregs[15] == 2);
+//
+// There is no decoded cache or demand paging here; every instruction is decoded each time it
+// runs, like RISCVContainer::ExecuteUncached. A static_assert on its results
+// therefore checks the instruction semantics RISCVContainer executes at runtime.
+template<size_t N>
+struct RISCVConstexprContainer
+{
+    u32 xregs[32] = {};
+    // Guest addresses are byte offsets into the image, as in RISCVContainer
+    u32 image[N] = {};
+    // Index of the next instruction in image
+    size_t pc = 0;
+
+    // Same block-based instret accounting as RISCVContainer
+    size_t block_start = 0;
+    u64 retired_count = 0;
+
+    constexpr RISCVConstexprContainer(const u32 (&program)[N])
+    {
+        for (size_t ii = 0; ii < N; ++ii)
+            image[ii] = program[ii];
+    }
+
+    constexpr void RetireBlock()
+    {
+        retired_count += pc - block_start;
+        block_start = pc;
+    }
+    constexpr void Jump(size_t target)
+    {
+        RetireBlock();
+        pc = target;
+        block_start = pc;
+    }
+    constexpr u64 InstructionsRetired() const
+    {
+        return retired_count + (pc - block_start);
+    }
+    constexpr u64 Cycles() const
+    {
+        return InstructionsRetired();
+    }
+
+    constexpr bool DataWithinBounds(u32 address, u32 width) const
+    {
+        return address < N * sizeof(u32) && width <= N * sizeof(u32) - address;
+    }
+    constexpr void StoreData(u32 address, u32 value, u32 width)
+    {
+        StoreLittleEndian(image, address, value, width);
+    }
+    constexpr u32 Fetch() const
+    {
+        return image[pc];
+    }
+
+    // There is no wall clock at compile time, so `time` never advances
+    constexpr bool ReadCSR(u32 csr, u32& value) const
+    {
+        return ReadCounterCSR(csr, Cycles(), 0, InstructionsRetired(), value);
+    }
+    constexpr bool WriteCSR(u32, u32)
+    {
+        return false;
+    }
+
+    constexpr int Execute()
+    {
+        while (1)
+        {
+            xregs[0] = 0;
+            if (pc >= N)
+                return ErrorOutOfBounds;
+            int result = ExecuteInstruction(*this);
+            if (result != 0)
+                return result;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef SIMPLERISCV_EXTENSIONS_HPP
+#define SIMPLERISCV_EXTENSIONS_HPP
+
+#include "riscv_vm.hpp"
+
+// Currently implemented:
+// From I-base:
+// addi
+// sb, sh, sw
+
+// From Zicsr-extension:
+// csrrw, csrrs, csrrc, csrrwi, csrrsi, csrrci
+
+// From Zicntr-extension:
+// cycle, time, instret (and their high halves)
+
+// From Zifencei-extension:
+// fence.i
+
+// Instruction decoding and semantics, written once and shared by RISCVContainer and
+// RISCVConstexprContainer. Everything here is constexpr, so a machine that is itself usable
+// in constant expressions can run guest code at compile time.
+//
+// Each extension decodes an instruction into a DecodedInstruction. It returns 0 if the
+// instruction is its own, ErrorNotHandled if it belongs to another extension, or another
+// error code. Decoding does not touch the machine; running the result is ExecuteDecoded's job.
+
+// Base 32-bit ISA
+constexpr int BaseI(RISCVInstruction insn, DecodedInstruction& decoded)
+{
+    if (insn.family() != 3)
+        return ErrorNotHandled;
+    if (insn.opcode() == 4)
+    {
+        auto i = RV32I_TypeI{insn};
+        if (i.funct3() == 0) // addi (add signed immediate)
+        {
+            decoded = {OpAddi, (u8)i.rd(), (u8)i.rs1(), 0, (u32)i.imm()};
+            return 0;
+        }
+    }
+    if (insn.opcode() == 8)
+    {
+        auto st = RV32I_TypeS{insn};
+        if (st.funct3() > 2)
+            return ErrorNotHandled;
+        decoded = {(u8)(OpSb + st.funct3()), 0, (u8)st.rs1(), (u8)st.rs2(), (u32)st.offset()}; // sb, sh, sw
+        return 0;
+    }
+    return ErrorNotHandled;
+}
+// Atomic instructions
+constexpr int ExtensionA(RISCVInstruction, DecodedInstruction&)
+{
+    return ErrorNotHandled;
+}
+// Bit manipulation
+constexpr int ExtensionB(RISCVInstruction, DecodedInstruction&)
+{
+    return ErrorNotHandled;
+}
+// Compressed instructions
+constexpr int ExtensionC(RISCVInstruction, DecodedInstruction&)
+{
+    return ErrorNotHandled;
+}
+// Double-precision floating-point
+constexpr int ExtensionD(RISCVInstruction, DecodedInstruction&)
+{
+    return ErrorNotHandled;
+}
+// Single-precision floating-point
+constexpr int ExtensionF(RISCVInstruction, DecodedInstruction&)
+{
+    return ErrorNotHandled;
+}
+// Quad-Precision Floating-Point (IEEE 754-2008)
+constexpr int ExtensionQ(RISCVInstruction, DecodedInstruction&)
+{
+    return ErrorNotHandled;
+}
+// Basic bit-manipulation
+constexpr int ExtensionZbb(RISCVInstruction, DecodedInstruction&)
+{
+    return ErrorNotHandled;
+}
+
+// Control and status register instructions
+constexpr int ExtensionZicsr(RISCVInstruction insn, DecodedInstruction& decoded)
+{
+    if (insn.family() != 3 || insn.opcode() != 0x1C)
+        return ErrorNotHandled;
+    auto i = RV32I_TypeI{insn};
+    // funct3 0 is ecall/ebreak/etc., 4 is reserved
+    if (i.funct3() == 0 || i.funct3() == 4)
+        return ErrorNotHandled;
+    // funct3 1-3 are csrrw/csrrs/csrrc and 5-7 their immediate forms, whose rs1 field is a
+    // 5-bit zero-extended immediate
+    u8 op = (i.funct3() & 4) ? OpCsrrwi + (i.funct3() & 3) - 1 : OpCsrrw + i.funct3() - 1;
+    decoded = {op, (u8)i.rd(), (u8)i.rs1(), 0, i.imm12()};
+    return 0;
+}
+
+// Instruction-fetch fence
+constexpr int ExtensionZifencei(RISCVInstruction insn, DecodedInstruction& decoded)
+{
+    if (insn.family() != 3 || insn.opcode() != 0x03 || RV32I_TypeI{insn}.funct3() != 1)
+        return ErrorNotHandled;
+    decoded = {OpFenceI, 0, 0, 0, 0};
+    return 0;
+}
+
+// Offers the instruction to every extension in turn
+constexpr int Decode(RISCVInstruction insn, DecodedInstruction& decoded)
+{
+    int result = BaseI(insn, decoded);
+    if (result == ErrorNotHandled) result = ExtensionZifencei(insn, decoded);
+    if (result == ErrorNotHandled) result = ExtensionZicsr(insn, decoded);
+    if (result == ErrorNotHandled) result = ExtensionC(insn, decoded);
+    if (result == ErrorNotHandled) result = ExtensionB(insn, decoded);
+    if (result == ErrorNotHandled) result = ExtensionF(insn, decoded);
+    if (result == ErrorNotHandled) result = ExtensionD(insn, decoded);
+    if (result == ErrorNotHandled) result = ExtensionA(insn, decoded);
+    return result;
+}
+
+// Runs a decoded instruction on a machine, which provides:
+//   u32 xregs[32]
+//   pc                                          the current instruction (a pointer or an index)
+//   u32 Fetch()                                 the instruction word at pc
+//   void Jump(target)                           moves pc anywhere other than the next instruction
+//   bool DataWithinBounds(u32 address, u32 width)
+//   void StoreData(u32 address, u32 value, u32 width)
+//   bool ReadCSR(u32 csr, u32& value)           false when the CSR does not exist
+//   bool WriteCSR(u32 csr, u32 value)           false when the CSR is read-only or does not exist
+//
+// Returns 0 and advances pc if it executed the instruction, or an error code. Instructions
+// advance with ++pc; control transfers (jal, jalr, taken branches) must go through Jump()
+// instead, or instret and cycle will count the wrong straight-line run.
+// decoded may be the machine's cached entry for the instruction being run, which a store can
+// invalidate, so nothing reads it after StoreData.
+// Forced inline into the execute loops: as a call, dispatching an addi costs more than
+// decoding it again would.
+template<typename Machine>
+SRISCV_FORCE_INLINE constexpr int ExecuteDecoded(Machine& m, const DecodedInstruction& decoded)
+{
+    switch (decoded.op)
+    {
+    case OpAddi:
+        m.xregs[decoded.rd] = m.xregs[decoded.rs1] + decoded.imm;
+        break;
+    case OpSb:
+    case OpSh:
+    case OpSw:
+    {
+        u32 address = m.xregs[decoded.rs1] + decoded.imm;
+        u32 width = 1u << (decoded.op - OpSb);
+        if (!m.DataWithinBounds(address, width))
+            return ErrorStoreAccessFault;
+        m.StoreData(address, m.xregs[decoded.rs2], width);
+        break;
+    }
+    case OpFenceI:
+        // A machine that caches decoded instructions invalidates them as stores land (see
+        // RISCVContainer::StoreData), so there is nothing left to flush when this retires.
+        break;
+    case OpCsrrw:
+    case OpCsrrs:
+    case OpCsrrc:
+    case OpCsrrwi:
+    case OpCsrrsi:
+    case OpCsrrci:
+    {
+        bool immediate = decoded.op >= OpCsrrwi;
+        u32 kind = decoded.op - (immediate ? OpCsrrwi : OpCsrrw);
+        u32 source = immediate ? decoded.rs1 : m.xregs[decoded.rs1];
+        u32 old = 0;
+        if (!m.ReadCSR(decoded.imm, old))
+            return ErrorIllegalInstruction;
+
+        // csrrw always writes. csrrs/csrrc with x0 (or uimm 0) do not, which is what makes
+        // "csrr rd, csr" legal on read-only CSRs.
+        if (kind == 0) // csrrw, csrrwi
+        {
+            if (!m.WriteCSR(decoded.imm, source))
+                return ErrorIllegalInstruction;
+        }
+        else if (decoded.rs1 != 0) // csrrs, csrrsi, csrrc, csrrci
+        {
+            u32 result = kind == 1 ? old | source : old & ~source;
+            if (!m.WriteCSR(decoded.imm, result))
+                return ErrorIllegalInstruction;
+        }
+        m.xregs[decoded.rd] = old;
+        break;
+    }
+    default:
+        return ErrorNotHandled;
+    }
+    ++m.pc;
+    return 0;
+}
+
+// Fetches, decodes and runs the instruction at pc, without any cache
+template<typename Machine>
+constexpr int ExecuteInstruction(Machine& m)
+{
+    DecodedInstruction decoded = {};
+    int result = Decode(RISCVInstruction{m.Fetch()}, decoded);
+    if (result != 0)
+        return result;
+    return ExecuteDecoded(m, decoded);
+}
+
+#endif
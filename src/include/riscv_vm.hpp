@@ -10,7 +10,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <bit>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <ranges>
@@ -65,6 +67,10 @@ struct RV32I_TypeI
     constexpr auto imm12() const noexcept {
         return extract_bits<20, 31>(m_value);
     }
+    // imm12 sign-extended
+    constexpr s32 imm() const noexcept {
+        return (s32)m_value >> 20;
+    }
 
     constexpr operator u32() const noexcept {
         return m_value;
@@ -93,6 +99,10 @@ struct RV32I_TypeS
     constexpr auto imm7() const noexcept {
         return extract_bits<25, 31>(m_value);
     }
+    // The immediate is split: imm[11:5] in imm7, imm[4:0] where rd would be
+    constexpr s32 offset() const noexcept {
+        return ((s32)(m_value & 0xFE000000) >> 20) | (s32)rd();
+    }
 
     constexpr operator u32() const noexcept {
         return m_value;
@@ -248,8 +258,84 @@ __attribute((noreturn)) static void RVCore_CriticalError(const char* message)
 
 #define DefaultRISCVStackSize 0x20000
 
+// Guest image that is copied in one page at a time, the first time a page is executed or written.
+// The words must stay valid for the lifetime of the container (e.g. an mmap'd file).
+struct DemandPagedImage
+{
+    const u32* words;
+    size_t word_count;
+};
+
 #define ErrorOutOfBounds 0x1
 #define ErrorNotHandled 0x2
+#define ErrorIllegalInstruction 0x3
+#define ErrorStoreAccessFault 0x4
+
+// Zicntr unprivileged counters. On RV32 the upper 32 bits are read through the *H CSRs.
+#define CSR_Cycle 0xC00
+#define CSR_Time 0xC01
+#define CSR_InstRet 0xC02
+#define CSR_CycleH 0xC80
+#define CSR_TimeH 0xC81
+#define CSR_InstRetH 0xC82
+
+// Frequency of the `time` CSR, backed by the host's monotonic clock (1 tick = 1 microsecond)
+#define TimerFrequencyHz 1000000
+
+// Selects the Zicntr counter (or its upper half) a CSR number refers to
+constexpr bool ReadCounterCSR(u32 csr, u64 cycles, u64 time, u64 instret, u32& value)
+{
+    switch (csr)
+    {
+    case CSR_Cycle:    value = (u32)cycles; return true;
+    case CSR_CycleH:   value = (u32)(cycles >> 32); return true;
+    case CSR_Time:     value = (u32)time; return true;
+    case CSR_TimeH:    value = (u32)(time >> 32); return true;
+    case CSR_InstRet:  value = (u32)instret; return true;
+    case CSR_InstRetH: value = (u32)(instret >> 32); return true;
+    }
+    return false;
+}
+
+// Stores the low `width` bytes of value at a guest byte address in word-sized memory. Guest
+// memory is little-endian whatever the host is: byte n of a word is bits 8n..8n+7 of its value,
+// so each byte is merged into its word rather than copying host bytes.
+template<typename Word>
+constexpr void StoreLittleEndian(Word* words, u32 address, u32 value, u32 width)
+{
+    for (u32 ii = 0; ii < width; ++ii)
+    {
+        u32 byte = address + ii;
+        u32 shift = (byte % 4) * 8;
+        u32 merged = (u32{words[byte / 4]} & ~(0xFFu << shift)) | (((value >> (ii * 8)) & 0xFF) << shift);
+        words[byte / 4] = Word{merged};
+    }
+}
+
+// Operations an instruction decodes to. OpNone (0) marks a slot that has not been decoded yet.
+// Groups that only differ by width or kind are kept in encoding order, so the executor can
+// derive it from the distance to the first op of the group.
+enum DecodedOp : u8
+{
+    OpNone,
+    OpAddi,
+    OpSb, OpSh, OpSw,
+    OpFenceI,
+    OpCsrrw, OpCsrrs, OpCsrrc,
+    OpCsrrwi, OpCsrrsi, OpCsrrci,
+};
+
+// An instruction with its operands already pulled out of the encoding, so running it again
+// skips fetching and decoding the word. imm is sign-extended where the encoding says so; for
+// the CSR ops it holds the CSR number, and the csr*i forms keep their uimm in rs1.
+struct DecodedInstruction
+{
+    u8 op;
+    u8 rd;
+    u8 rs1;
+    u8 rs2;
+    u32 imm;
+};
 
 
 struct RISCVContainer
@@ -294,16 +380,24 @@ struct RISCVContainer
     {
         std::unique_ptr<RISCVInstruction[]> m_data;
         size_t m_size;
-
-        constexpr InstructionBlock(size_t size)
+        // Pages are copied from here by LoadPage. Null for images that were copied in full at
+        // construction; a demand-paged image keeps pointing at its source even once every
+        // page has been loaded.
+        const u32* m_source = nullptr;
+
+        // Left uninitialized: every word is either copied in by the constructor or by LoadPage
+        // before it is read, so large images are never touched up front.
+        InstructionBlock(size_t size)
           : m_data{new(std::nothrow) RISCVInstruction[size]}
           , m_size{size}
         {
             if (!m_data)
                 RVCore_CriticalError("Failed to allocate instruction block");
-            memset(m_data.get(), '\000', size);
         }
     public:
+        // Instructions per page
+        static constexpr size_t page_size = 4096 / sizeof(RISCVInstruction);
+
         // accepts any range, even ones with non contiguous memory (a linked list for example (dont do that though))
         template<stdr::range R>
         constexpr InstructionBlock(R&& instructions)
@@ -321,7 +415,32 @@ struct RISCVContainer
             std::memcpy(m_data.get(), stdr::data(instructions), stdr::size(instructions) * sizeof(stdr::range_value_t<R>));
         }
 
-        constexpr RISCVInstruction const* data() const noexcept {
+        InstructionBlock(DemandPagedImage image)
+          : InstructionBlock{image.word_count}
+        {
+            m_source = image.words;
+        }
+
+        // Brings a page in from the source image. Does nothing when the image was copied eagerly.
+        void LoadPage(size_t page)
+        {
+            if (!m_source)
+                return;
+            size_t first = page * page_size;
+            std::memcpy(m_data.get() + first, m_source + first, PageLength(page) * sizeof(RISCVInstruction));
+        }
+        // The last page may be short
+        size_t PageLength(size_t page) const noexcept {
+            return std::min(page_size, m_size - page * page_size);
+        }
+        size_t page_count() const noexcept {
+            return (m_size + page_size - 1) / page_size;
+        }
+
+        RISCVInstruction const* data() const noexcept {
+            return m_data.get();
+        }
+        RISCVInstruction* data() noexcept {
             return m_data.get();
         }
         constexpr size_t size() const noexcept {
@@ -331,25 +450,136 @@ struct RISCVContainer
 
     InstructionBlock instruction_block;
     // uint8_t* stack_region;
+    // Only ever changed by ++pc (falling through to the next instruction) or by Jump().
+    // Assigning it directly breaks the instret/cycle accounting below.
     RISCVInstruction const* pc;
 
+    // Instructions are not counted one by one. Everything from block_start up to pc is a
+    // straight-line run that has retired; Jump() folds it into retired_count before pc moves
+    // anywhere else.
+    RISCVInstruction const* block_start;
+    u64 retired_count = 0;
+    std::chrono::steady_clock::time_point time_origin;
+
+    // Decoded form of instruction_block, one entry per instruction (op is OpNone until the
+    // instruction first runs). Execute trusts it, so stores into code must invalidate the
+    // slots they touch (see StoreData).
+    std::unique_ptr<DecodedInstruction[]> decoded_instructions;
+
+    // Software page table. A page is loaded (and its decoded_instructions cleared) the first
+    // time it is fetched from or stored to. Until then its words in instruction_block are
+    // uninitialized memory, so anything reading instruction_block.data() directly must call
+    // EnsurePage or LoadAllPages first.
+    std::unique_ptr<u8[]> loaded_pages;
+    // The page pc was last found in. Execute only consults the page table when pc leaves it.
+    // Starts as an empty range, so the first fetch always does.
+    RISCVInstruction const* fetch_begin;
+    RISCVInstruction const* fetch_end;
+
+    void EnsurePage(size_t page)
+    {
+        if (loaded_pages[page])
+            return;
+        instruction_block.LoadPage(page);
+        memset(decoded_instructions.get() + page * InstructionBlock::page_size, 0,
+            instruction_block.PageLength(page) * sizeof(DecodedInstruction));
+        loaded_pages[page] = 1;
+    }
+    bool PageLoaded(size_t page) const
+    {
+        return loaded_pages[page] != 0;
+    }
+    // For embedders that want to read the whole image through instruction_block.data()
+    void LoadAllPages()
+    {
+        for (size_t ii = 0; ii < instruction_block.page_count(); ++ii)
+            EnsurePage(ii);
+    }
+    bool EnterFetchPage();
+
     bool AddressWithinBounds(const void* address)
     {
         return address >= instruction_block.data() &&
             address < instruction_block.data() + instruction_block.size();
     }
 
+    // Guest addresses are byte offsets into instruction_block; code and data share it.
+    bool DataWithinBounds(u32 address, u32 width)
+    {
+        return address < instruction_block.size() * sizeof(RISCVInstruction) &&
+            width <= instruction_block.size() * sizeof(RISCVInstruction) - address;
+    }
+
     RISCVContainer() = delete;
     RISCVContainer(const uint32_t* instructions, size_t array_size)
       : instruction_block(std::views::counted(instructions, (s64)(array_size / 4)))
     //   , stack_region{nullptr}
-      , pc{instruction_block.data()} {}
+      , pc{instruction_block.data()}
+      , block_start{pc}
+      , time_origin{std::chrono::steady_clock::now()}
+      , decoded_instructions{new DecodedInstruction[instruction_block.size()]}
+      , loaded_pages{new u8[instruction_block.page_count()]()}
+      , fetch_begin{instruction_block.data()}
+      , fetch_end{fetch_begin} {}
+
+    RISCVContainer(DemandPagedImage image)
+      : instruction_block(image)
+      , pc{instruction_block.data()}
+      , block_start{pc}
+      , time_origin{std::chrono::steady_clock::now()}
+      , decoded_instructions{new DecodedInstruction[instruction_block.size()]}
+      , loaded_pages{new u8[instruction_block.page_count()]()}
+      , fetch_begin{instruction_block.data()}
+      , fetch_end{fetch_begin} {}
 
     template<stdr::range R>
     RISCVContainer(R&& instruction_range)
         : instruction_block(std::forward<R>(instruction_range))
     //   , stack_region{nullptr}
-      , pc{instruction_block.data()} {}
+      , pc{instruction_block.data()}
+      , block_start{pc}
+      , time_origin{std::chrono::steady_clock::now()}
+      , decoded_instructions{new DecodedInstruction[instruction_block.size()]}
+      , loaded_pages{new u8[instruction_block.page_count()]()}
+      , fetch_begin{instruction_block.data()}
+      , fetch_end{fetch_begin} {}
+
+    void RetireBlock()
+    {
+        retired_count += pc - block_start;
+        block_start = pc;
+    }
+
+    // The only way to move pc anywhere other than the next instruction: taken branches, jumps,
+    // traps, and embedders changing where execution resumes. Closes the current straight-line run.
+    void Jump(RISCVInstruction const* target)
+    {
+        RetireBlock();
+        pc = target;
+        block_start = pc;
+    }
+
+    void StoreData(u32 address, u32 value, u32 width);
+
+    // Counters readable by the embedder as well as by guest code through Zicntr.
+    // This is not a pipelined core, so every instruction takes exactly one cycle.
+    u64 InstructionsRetired() const
+    {
+        return retired_count + (pc - block_start);
+    }
+    u64 Cycles() const
+    {
+        return InstructionsRetired();
+    }
+    u64 Time() const
+    {
+        auto elapsed = std::chrono::steady_clock::now() - time_origin;
+        return std::chrono::duration_cast<std::chrono::duration<u64, std::ratio<1, TimerFrequencyHz>>>(elapsed).count();
+    }
+
+    // Returns false when the CSR does not exist or cannot be accessed that way.
+    bool ReadCSR(u32 csr, u32& value) const;
+    bool WriteCSR(u32 csr, u32 value);
 
     static constexpr auto as_u = [](u32 v){return std::bit_cast<RV32I_TypeU>(v);};
     static constexpr auto as_s = [](u32 v){return std::bit_cast<RV32I_TypeS>(v);};
@@ -358,24 +588,17 @@ struct RISCVContainer
     static constexpr auto as_b = [](u32 v){return std::bit_cast<RV32I_TypeB>(v);};
     static constexpr auto as_j = [](u32 v){return std::bit_cast<RV32I_TypeJ>(v);};
 
-    // Base 32-bit ISA
-    int BaseI();
-    // Atomic instructions
-    int ExtensionA();
-    // Bit manipulation
-    int ExtensionB();
-    // Compressed instructions
-    int ExtensionC();
-    // Double-precision floating-point
-    int ExtensionD();
-    // Single-precision floating-point
-    int ExtensionF();
-    // Basic bit-manipulation
-    int ExtensionZbb();
-    // Quad-Precision Floating-Point (IEEE 754-2008)
-    int ExtensionQ();
+    u32 Fetch() const
+    {
+        return *pc;
+    }
 
+    // Decoding and the instruction semantics themselves are shared with
+    // RISCVConstexprContainer, see riscv_extensions.hpp.
     int Execute();
+    // Same semantics as Execute, but decodes every instruction each time it runs instead of
+    // using decoded_instructions. Used as the reference engine for differential testing.
+    int ExecuteUncached();
 };
 
 #endif
\ No newline at end of file
@@ -1,72 +1,75 @@
 #include "riscv_vm.hpp"
+#include "riscv_extensions.hpp"
 
-// Currently implemented:
-// From I-base:
-// addi, slli, slti, sltiu, xori, srli, srai, ori, andi
-// auipc
-// add, sub, sll, slt, sltu, xor, srl, sra, or, and
-// lui
-// jal
-// beq bne blt bge bltu bgeu
-
-// From Zbb-extension:
-// clz, ctz, max, maxu, min, minu, orn
-
-int RISCVContainer::BaseI()
+bool RISCVContainer::ReadCSR(u32 csr, u32& value) const
 {
-    RISCVInstruction insn = *pc++;
-    if (insn.family() != 3)
-        return ErrorNotHandled;
-    if (insn.opcode() == 4)
-    {
-        if (i.funct3() == 0) // addi (add signed immediate)
-            xregs[i.rd()] = xregs[i.rs1()] + (signed)i.imm12();
-    }
-    return ErrorNotHandled;
+    // Only ask the host clock when it is actually being read
+    u64 time = (csr == CSR_Time || csr == CSR_TimeH) ? Time() : 0;
+    return ReadCounterCSR(csr, Cycles(), time, InstructionsRetired(), value);
 };
-int RISCVContainer::ExtensionA()
+bool RISCVContainer::WriteCSR([[maybe_unused]] u32 csr, [[maybe_unused]] u32 value)
 {
-    return 0;
+    // The Zicntr counters are read-only shadows, and they are the only CSRs so far
+    return false;
 };
-int RISCVContainer::ExtensionB()
-{
-    return 0;
-};
-int RISCVContainer::ExtensionC()
-{
-    return 0;
-};
-int RISCVContainer::ExtensionD()
-{
-    return 0;
-};
-int RISCVContainer::ExtensionF()
+
+bool RISCVContainer::EnterFetchPage()
 {
-    return 0;
+    if (!AddressWithinBounds(pc))
+        return false;
+    size_t page = (pc - instruction_block.data()) / InstructionBlock::page_size;
+    EnsurePage(page);
+    fetch_begin = instruction_block.data() + page * InstructionBlock::page_size;
+    fetch_end = fetch_begin + instruction_block.PageLength(page);
+    return true;
 };
-int RISCVContainer::ExtensionQ()
+
+void RISCVContainer::StoreData(u32 address, u32 value, u32 width)
 {
-    return 0;
+    // A misaligned store can straddle two pages
+    EnsurePage(address / sizeof(RISCVInstruction) / InstructionBlock::page_size);
+    EnsurePage((address + width - 1) / sizeof(RISCVInstruction) / InstructionBlock::page_size);
+    StoreLittleEndian(instruction_block.data(), address, value, width);
+    // Only the instructions overlapped by the write lose their decoded form; the rest of
+    // the page (and of the program) keeps it.
+    u32 first = address / sizeof(RISCVInstruction);
+    u32 last = (address + width - 1) / sizeof(RISCVInstruction);
+    for (u32 ii = first; ii <= last; ++ii)
+        decoded_instructions[ii].op = OpNone;
 };
-int RISCVContainer::ExtensionZbb()
+
+int RISCVContainer::Execute()
 {
-    return 0;
+    RISCVInstruction const* const base = instruction_block.data();
+    DecodedInstruction* const cache = decoded_instructions.get();
+    while (1)
+    {
+        xregs[0] = 0;
+        if ((pc < fetch_begin || pc >= fetch_end) && !EnterFetchPage())
+            return ErrorOutOfBounds;
+        DecodedInstruction& decoded = cache[pc - base];
+        if (decoded.op == OpNone)
+        {
+            int result = Decode(*pc, decoded);
+            if (result != 0)
+                return result;
+        }
+        int result = ExecuteDecoded(*this, decoded);
+        if (result != 0)
+            return result;
+    }
 };
 
-int RISCVContainer::Execute()
+int RISCVContainer::ExecuteUncached()
 {
     while (1)
     {
         xregs[0] = 0;
-        if (!AddressWithinBounds(pc))
+        if ((pc < fetch_begin || pc >= fetch_end) && !EnterFetchPage())
             return ErrorOutOfBounds;
-        if (BaseI()) continue;
-        if (ExtensionC()) continue;
-        if (ExtensionB()) continue;
-        if (ExtensionF()) continue;
-        if (ExtensionD()) continue;
-        if (ExtensionA()) continue;
-        return ErrorNotHandled;
+        int result = ExecuteInstruction(*this);
+        if (result != 0)
+            return result;
     }
 };
 
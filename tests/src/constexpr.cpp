@@ -0,0 +1,64 @@
+#include "riscv_constexpr.hpp"
+
+// Every check here runs the guest at compile time, through the same decoding and instruction
+// semantics RISCVContainer uses at runtime (riscv_extensions.hpp); if this file builds, they passed.
+
+constexpr auto addi_test = [] {
+	RISCVConstexprContainer vm({
+		0x00178793, // addi a5,a5,1
+		0x00178793, // addi a5,a5,1
+		0x00178793, // addi a5,a5,1
+		0xFFF70713  // addi a4,a4,-1
+	});
+	vm.Execute();
+	return vm;
+}();
+static_assert(addi_test.xregs[15] == 3);
+static_assert(addi_test.xregs[14] == 0xFFFFFFFF);
+
+constexpr auto store_test = [] {
+	RISCVConstexprContainer vm({
+		0x00000000, // data
+		0x00B02023, // sw a1,0(zero)
+		0x00C000A3  // sb a2,1(zero)
+	});
+	vm.xregs[11] = 0x12345678;
+	vm.xregs[12] = 0xAB;
+	vm.Jump(1);
+	vm.Execute();
+	return vm;
+}();
+static_assert(store_test.image[0] == 0x1234AB78);
+
+constexpr auto fencei_test = [] {
+	RISCVConstexprContainer vm({
+		0x00B02423, // sw a1,8(zero)
+		0x0000100F, // fence.i
+		0x00178793  // addi a5,a5,1, replaced with rdinstret a0
+	});
+	vm.xregs[11] = 0xC0202573;
+	vm.Execute();
+	return vm;
+}();
+static_assert(fencei_test.xregs[10] == 2 && fencei_test.xregs[15] == 0);
+static_assert(fencei_test.InstructionsRetired() == 3);
+
+static_assert([] {
+	RISCVConstexprContainer vm({
+		0xC0251073  // csrw instret,a0
+	});
+	return vm.Execute();
+}() == ErrorIllegalInstruction);
+
+int main()
+{
+	// The runtime interpreter has to agree with the constant-evaluated one
+	const uint32_t rv32_bin[] = { 0x00B02423, 0x0000100F, 0x00178793 };
+	RISCVContainer rvtest(rv32_bin, sizeof(rv32_bin));
+	rvtest.xregs[11] = 0xC0202573;
+	rvtest.Execute();
+	for (int ii = 1; ii < 32; ++ii)
+		if (rvtest.xregs[ii] != fencei_test.xregs[ii])
+			return 1;
+	return 0;
+}
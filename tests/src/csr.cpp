@@ -0,0 +1,38 @@
+#include "riscv_vm.hpp"
+
+// Guest-visible instret/cycle values and the read-only checks are covered by programs/csr.rvt
+// and programs/csr_readonly.rvt. What is left here is what differs from run to run (time) or
+// needs the embedder's side of the counters.
+const uint32_t rv32_count_bin[] = {
+	0x00178793, // addi a5,a5,1
+	0x00178793, // addi a5,a5,1
+	0xC0202573  // rdinstret a0
+};
+const uint32_t rv32_time_bin[] = {
+	0xC0102573, // rdtime a0
+	0xC01025F3, // rdtime a1
+	0xC8102673, // rdtimeh a2
+	0xC80026F3  // rdcycleh a3
+};
+int main()
+{
+	RISCVContainer rvcount(rv32_count_bin, sizeof(rv32_count_bin));
+	if (rvcount.InstructionsRetired() != 0)
+		return 1;
+	rvcount.Execute();
+	if (rvcount.InstructionsRetired() != 3 || rvcount.Cycles() != 3)
+		return 1;
+
+	// Start both counters just past 2^32 so the high halves read 1
+	RISCVContainer rvtime(rv32_time_bin, sizeof(rv32_time_bin));
+	rvtime.retired_count = 0x100000000;
+	rvtime.time_origin -= std::chrono::duration<u64, std::ratio<1, TimerFrequencyHz>>(0x100000000);
+	u64 host_before = rvtime.Time();
+	rvtime.Execute();
+	u64 host_after = rvtime.Time();
+
+	// time follows the host's monotonic clock, so it never goes backwards
+	if (host_after < host_before || rvtime.xregs[11] < rvtime.xregs[10])
+		return 1;
+	return rvtime.xregs[12] != 1 || rvtime.xregs[13] != 1;
+}
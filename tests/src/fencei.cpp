@@ -0,0 +1,32 @@
+#include "riscv_vm.hpp"
+
+const uint32_t rv32_bin[] = {
+	0x00178793, // addi a5,a5,1
+	0x00170713, // addi a4,a4,1
+	0x00B02023, // sw a1,0(zero) (overwrites the first instruction)
+	0x0000100F  // fence.i
+};
+int main()
+{
+	RISCVContainer rvtest(rv32_bin, sizeof(rv32_bin));
+	// First run rewrites the addi with itself. Only its decoded entry is dropped; the
+	// instructions around it keep theirs.
+	rvtest.xregs[11] = 0x00178793;
+	if (rvtest.Execute() != ErrorOutOfBounds)
+		return 1;
+	if (rvtest.decoded_instructions[0].op != OpNone)
+		return 1;
+	for (int ii = 1; ii < 4; ++ii)
+		if (rvtest.decoded_instructions[ii].op == OpNone)
+			return 1;
+
+	// Second run replaces the already-decoded addi with rdinstret a0, which the third run
+	// must execute instead of the stale addi
+	rvtest.xregs[11] = 0xC0202573;
+	rvtest.Jump(rvtest.instruction_block.data());
+	rvtest.Execute();
+	rvtest.Jump(rvtest.instruction_block.data());
+	if (rvtest.Execute() != ErrorOutOfBounds)
+		return 1;
+	return rvtest.xregs[10] != 8 || rvtest.xregs[15] != 2;
+}
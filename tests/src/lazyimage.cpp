@@ -0,0 +1,22 @@
+#include "riscv_vm.hpp"
+
+#include <vector>
+
+// Execution results for this layout are covered by programs/pages.rvt under the demand-paged
+// engine; this only checks which pages the page table actually loaded.
+int main()
+{
+	// Three pages: data, an untouched page, then code that stores into the data page
+	std::vector<uint32_t> image(RISCVContainer::InstructionBlock::page_size * 2 + 2, 0);
+	image[RISCVContainer::InstructionBlock::page_size * 2] = 0x00B02023;     // sw a1,0(zero)
+	image[RISCVContainer::InstructionBlock::page_size * 2 + 1] = 0x00178793; // addi a5,a5,1
+
+	RISCVContainer rvtest(DemandPagedImage{ image.data(), image.size() });
+	for (size_t ii = 0; ii < 3; ++ii)
+		if (rvtest.PageLoaded(ii))
+			return 1;
+
+	rvtest.Jump(rvtest.instruction_block.data() + RISCVContainer::InstructionBlock::page_size * 2);
+	rvtest.Execute();
+	return !rvtest.PageLoaded(0) || rvtest.PageLoaded(1) || !rvtest.PageLoaded(2);
+}
@@ -1,6 +1,12 @@
+#include "riscv_vm.hpp"
+
 #include <filesystem>
 #include <string>
 #include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 #if defined(__linux__) || defined(__OpenBSD__) || defined(__FreeBSD__)
 #define RUNNER_SUPPORTED_POPEN
@@ -12,6 +18,10 @@
 #error "No test runner implementation for this platform."
 #endif
 
+#ifndef RISCV_TEST_PROGRAM_DIR
+#define RISCV_TEST_PROGRAM_DIR "./programs"
+#endif
+
 #if defined(RUNNER_SUPPORTED_WIN32)
 int testprocess(const wchar_t* path)
 #elif defined(RUNNER_SUPPORTED_POPEN)
@@ -44,20 +54,308 @@ int testprocess(const char* path)
 	return exitcode;
 }
 
-int main()
+// Test programs (*.rvt in RISCV_TEST_PROGRAM_DIR) are plain text, one directive per line:
+//   code <word>...        append 32-bit words to the guest image (instructions or data)
+//   zero <count>          append count zero words
+//   binary <file>         append a raw little-endian image, relative to the .rvt file
+//                         (e.g. a riscv-tests binary flattened with objcopy -O binary)
+//   entry <address>       byte address execution starts at, 0 by default
+//   set x<n> <value>      register value before execution
+//   expect x<n> <value>   register value after execution
+//   expectmem <address> <value>
+//                         word at a guest byte address after execution
+//   tohost <address>      riscv-tests convention: passes only if the guest stored 1 there,
+//                         any other odd value is (failing test number << 1) | 1
+//   result <code>         expected return of Execute. By default ErrorOutOfBounds, which Execute
+//                         only returns when pc runs off the end of the image; guest faults such
+//                         as ErrorStoreAccessFault have their own codes and fail the default.
+// Numbers accept the usual C prefixes. '#' starts a comment.
+struct TestProgram
+{
+	std::vector<u32> image;
+	u32 entry = 0;
+	u32 initial_regs[32] = {};
+	std::vector<std::pair<u32, u32>> expect_regs;
+	std::vector<std::pair<u32, u32>> expect_mem;
+	bool has_tohost = false;
+	u32 tohost = 0;
+	int result = ErrorOutOfBounds;
+};
+
+struct TestResult
+{
+	std::string name;
+	bool passed;
+	std::string message;
+};
+
+// Every test program is run under every engine, and the engines must agree on the final
+// state as well as pass the expectations. Programs that read `time` will not compare equal.
+struct Engine
+{
+	const char* name;
+	int (RISCVContainer::*run)();
+	bool demand_paged;
+};
+static const Engine engines[] = {
+	{ "decoded", &RISCVContainer::Execute, false },
+	{ "reference", &RISCVContainer::ExecuteUncached, false },
+	{ "demand-paged", &RISCVContainer::Execute, true },
+};
+
+static bool parse_register(const char* text, u32& reg)
+{
+	if (text[0] != 'x')
+		return false;
+	char* end;
+	reg = (u32)strtoul(text + 1, &end, 10);
+	return end != text + 1 && *end == '\0' && reg < 32;
+}
+
+static bool parse_number(const char* text, u32& value)
+{
+	char* end;
+	value = (u32)strtoul(text, &end, 0);
+	return end != text && *end == '\0';
+}
+
+static bool load_program(const std::filesystem::path& path, TestProgram& program, std::string& error)
 {
-	for (auto& entry : std::filesystem::directory_iterator("./testbin"))
+	std::ifstream file(path);
+	if (!file)
+	{
+		error = "cannot open";
+		return false;
+	}
+	std::string line;
+	int lineno = 0;
+	while (std::getline(file, line))
+	{
+		++lineno;
+		line = line.substr(0, line.find('#'));
+
+		std::vector<std::string> tokens;
+		size_t pos = 0;
+		while ((pos = line.find_first_not_of(" \t\r", pos)) != std::string::npos)
+		{
+			size_t end = line.find_first_of(" \t\r", pos);
+			tokens.push_back(line.substr(pos, end - pos));
+			pos = end;
+		}
+		if (tokens.empty())
+			continue;
+
+		const std::string& op = tokens[0];
+		u32 a = 0, b = 0;
+		bool ok;
+		if (op == "code")
+		{
+			ok = tokens.size() > 1;
+			for (size_t ii = 1; ii < tokens.size() && ok; ++ii)
+			{
+				ok = parse_number(tokens[ii].c_str(), a);
+				program.image.push_back(a);
+			}
+		}
+		else if (op == "zero" && tokens.size() == 2)
+		{
+			ok = parse_number(tokens[1].c_str(), a);
+			program.image.resize(program.image.size() + a);
+		}
+		else if (op == "binary" && tokens.size() == 2)
+		{
+			std::ifstream bin(path.parent_path() / tokens[1], std::ios::binary);
+			std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(bin)), std::istreambuf_iterator<char>());
+			ok = bin.is_open() && bytes.size() % sizeof(u32) == 0;
+			// The file is little-endian whatever the host is
+			for (size_t ii = 0; ok && ii < bytes.size(); ii += sizeof(u32))
+				program.image.push_back(bytes[ii] | bytes[ii + 1] << 8 | bytes[ii + 2] << 16 | (u32)bytes[ii + 3] << 24);
+		}
+		else if (op == "entry" && tokens.size() == 2)
+			ok = parse_number(tokens[1].c_str(), program.entry);
+		else if (op == "set" && tokens.size() == 3)
+			ok = parse_register(tokens[1].c_str(), a) && parse_number(tokens[2].c_str(), program.initial_regs[a]);
+		else if (op == "expect" && tokens.size() == 3)
+		{
+			ok = parse_register(tokens[1].c_str(), a) && parse_number(tokens[2].c_str(), b);
+			program.expect_regs.push_back({a, b});
+		}
+		else if (op == "expectmem" && tokens.size() == 3)
+		{
+			ok = parse_number(tokens[1].c_str(), a) && parse_number(tokens[2].c_str(), b);
+			program.expect_mem.push_back({a, b});
+		}
+		else if (op == "tohost" && tokens.size() == 2)
+			ok = program.has_tohost = parse_number(tokens[1].c_str(), program.tohost);
+		else if (op == "result" && tokens.size() == 2)
+		{
+			ok = parse_number(tokens[1].c_str(), a);
+			program.result = (int)a;
+		}
+		else
+			ok = false;
+
+		if (!ok)
+		{
+			error = "bad directive on line " + std::to_string(lineno);
+			return false;
+		}
+	}
+	if (program.image.empty() || program.entry % sizeof(RISCVInstruction) != 0 ||
+		program.entry / sizeof(RISCVInstruction) > program.image.size())
 	{
-		std::filesystem::path entrypath = std::filesystem::absolute(entry.path());
-		int res = testprocess(entrypath.c_str());
-		const auto exename = entry.path().filename().string();
+		error = "empty image or bad entry point";
+		return false;
+	}
+	return true;
+}
+
+static bool read_word(RISCVContainer& container, u32 address, u32& value)
+{
+	if (address % sizeof(u32) != 0 || !container.DataWithinBounds(address, sizeof(u32)))
+		return false;
+	value = container.instruction_block.data()[address / sizeof(u32)];
+	return true;
+}
+
+static bool check_program(const TestProgram& program, RISCVContainer& container, int result, std::string& error)
+{
+	char buffer[128];
+	if (result != program.result)
+	{
+		snprintf(buffer, sizeof(buffer), "returned %i, expected %i", result, program.result);
+		error = buffer;
+		return false;
+	}
+	for (auto [reg, value] : program.expect_regs)
+	{
+		if (container.xregs[reg] != value)
+		{
+			snprintf(buffer, sizeof(buffer), "x%u is 0x%08X, expected 0x%08X", reg, container.xregs[reg], value);
+			error = buffer;
+			return false;
+		}
+	}
+	for (auto [address, value] : program.expect_mem)
+	{
+		u32 actual;
+		if (!read_word(container, address, actual) || actual != value)
+		{
+			snprintf(buffer, sizeof(buffer), "word at 0x%X is not 0x%08X", address, value);
+			error = buffer;
+			return false;
+		}
+	}
+	if (program.has_tohost)
+	{
+		u32 tohost = 0;
+		if (!read_word(container, program.tohost, tohost) || tohost != 1)
+		{
+			snprintf(buffer, sizeof(buffer), "tohost is 0x%X (failed test %u)", tohost, tohost >> 1);
+			error = buffer;
+			return false;
+		}
+	}
+	return true;
+}
+
+static TestResult run_program(const std::filesystem::path& path)
+{
+	TestResult res = { path.filename().string(), false, {} };
+	TestProgram program;
+	if (!load_program(path, program, res.message))
+		return res;
+
+	std::vector<u32> first_regs, first_memory;
+	int first_result = 0;
+	for (const Engine& engine : engines)
+	{
+		RISCVContainer container = engine.demand_paged
+			? RISCVContainer(DemandPagedImage{ program.image.data(), program.image.size() })
+			: RISCVContainer(program.image);
+		memcpy(container.xregs, program.initial_regs, sizeof(container.xregs));
+		container.Jump(container.instruction_block.data() + program.entry / sizeof(RISCVInstruction));
+		int result = (container.*engine.run)();
+		// Pages the guest never touched are still uninitialized until loaded
+		container.LoadAllPages();
+		if (!check_program(program, container, result, res.message))
+		{
+			res.message = std::string(engine.name) + ": " + res.message;
+			return res;
+		}
+
+		std::vector<u32> regs(container.xregs, container.xregs + 32);
+		std::vector<u32> memory(container.instruction_block.data(), container.instruction_block.data() + container.instruction_block.size());
+		if (&engine == &engines[0])
+		{
+			first_regs = regs;
+			first_memory = memory;
+			first_result = result;
+		}
+		else if (regs != first_regs || memory != first_memory || result != first_result)
+		{
+			res.message = std::string(engine.name) + " disagrees with " + engines[0].name;
+			return res;
+		}
+	}
+	res.passed = true;
+	return res;
+}
+
+static TestResult run_executable(const std::filesystem::path& path)
+{
+	std::filesystem::path entrypath = std::filesystem::absolute(path);
+	int code = testprocess(entrypath.c_str());
+	return { path.filename().string(), code == 0, "Code " + std::to_string(code) };
+}
+
+int main(int argc, char* argv[])
+{
+	// Standalone test executables from ./testbin, and test programs which are run in-process
+	std::vector<std::filesystem::path> executables, programs;
+	if (std::filesystem::is_directory("./testbin"))
+		for (auto& entry : std::filesystem::directory_iterator("./testbin"))
+			executables.push_back(entry.path());
+	const char* program_dir = argc > 1 ? argv[1] : RISCV_TEST_PROGRAM_DIR;
+	if (std::filesystem::is_directory(program_dir))
+		for (auto& entry : std::filesystem::directory_iterator(program_dir))
+			if (entry.path().extension() == ".rvt")
+				programs.push_back(entry.path());
+
+	size_t job_count = executables.size() + programs.size();
+	std::vector<TestResult> results(job_count);
+	std::atomic<size_t> next_job{0};
+	auto worker = [&]() {
+		size_t job;
+		while ((job = next_job++) < job_count)
+		{
+			if (job < executables.size())
+				results[job] = run_executable(executables[job]);
+			else
+				results[job] = run_program(programs[job - executables.size()]);
+		}
+	};
+
+	size_t thread_count = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, job_count ? job_count : 1);
+	std::vector<std::thread> threads;
+	for (size_t ii = 0; ii < thread_count; ++ii)
+		threads.emplace_back(worker);
+	for (auto& thread : threads)
+		thread.join();
+
+	std::sort(results.begin(), results.end(), [](const TestResult& a, const TestResult& b) { return a.name < b.name; });
+	int failures = 0;
+	for (const TestResult& res : results)
+	{
+		failures += !res.passed;
 		printf(
-			"%s%s%s: Code %i for %s\n",
-			res != 0 ? "\x1B[31m" : "\x1B[32m",
-			res != 0 ? "FAIL" : "PASS",
+			"%s%s%s: %s for %s\n",
+			!res.passed ? "\x1B[31m" : "\x1B[32m",
+			!res.passed ? "FAIL" : "PASS",
 			"\033[0m",
-			res,
-			exename.c_str());
+			res.message.empty() ? "OK" : res.message.c_str(),
+			res.name.c_str());
 	}
-	return 0;
-}
\ No newline at end of file
+	printf("%zu passed, %i failed\n", results.size() - failures, failures);
+	return failures != 0;
+}